@@ -8,6 +8,7 @@
 #define WT_DBO_DBACTION_IMPL_H_
 
 #include <Wt/Dbo/Exception>
+#include <functional>
 #include <iostream>
 #include <boost/lexical_cast.hpp>
 
@@ -271,7 +272,8 @@ template <class C>
 LoadDbAction<C>::LoadDbAction(MetaDbo<C>& dbo, Session::Mapping<C>& mapping,
 			      SqlStatement *statement, int& column)
   : LoadBaseAction(dbo, mapping, statement, column),
-    dbo_(dbo)
+    dbo_(dbo),
+    plan_(mapping.persistPlan_)
 { }
 
 template<class C>
@@ -299,7 +301,10 @@ void LoadDbAction<C>::visit(C& obj)
 
   start();
 
-  persist<C>::apply(obj, *this);
+  if (plan_.compile(obj, *session))
+    plan_.load(obj, dbo_, statement_, column_);
+  else
+    persist<C>::apply(obj, *this);
 
   if (!continueStatement && statement_->nextRow())
     throw Exception("Dbo load: multiple rows for id "
@@ -454,18 +459,27 @@ void SaveBaseAction::actCollection(const CollectionRef<C>& field)
 template <class C>
 SaveDbAction<C>::SaveDbAction(MetaDbo<C>& dbo, Session::Mapping<C>& mapping)
   : SaveBaseAction(dbo, mapping),
-    dbo_(dbo)
+    dbo_(dbo),
+    plan_(mapping.persistPlan_)
 { }
 
 template<class C>
 void SaveDbAction<C>::visit(C& obj)
 {
+  /*
+   * A compiled plan has no relations, and thus no dependencies and
+   * no sets.
+   */
+  bool compiled = plan_.compile(obj, *dbo_.session());
+
   /*
    * (1) Dependencies
    */
-  startDependencyPass();
+  if (!compiled) {
+    startDependencyPass();
 
-  persist<C>::apply(obj, *this);
+    persist<C>::apply(obj, *this);
+  }
 
   /*
    * (2) Self
@@ -483,7 +497,11 @@ void SaveDbAction<C>::visit(C& obj)
       isInsert_ = false;
 
     startSelfPass();
-    persist<C>::apply(obj, *this);
+
+    if (compiled)
+      plan_.bind(obj, dbo_, isInsert_, statement_, column_);
+    else
+      persist<C>::apply(obj, *this);
 
     if (!isInsert_) {
       dbo_.bindId(statement_, column_);
@@ -692,6 +710,48 @@ void SetReciproceAction::actWeakPtr(const WeakPtrRef<C>& field)
 template<class C>
 void SetReciproceAction::actCollection(const CollectionRef<C>& field)
 {
+}
+
+    /*
+     * GetReciproceAction
+     */
+
+template<class C>
+void GetReciproceAction::visit(C& obj)
+{
+  persist<C>::apply(obj, *this);
+}
+
+template<typename V>
+void GetReciproceAction::actId(V& value, const std::string& name, int size)
+{ }
+
+template<class C>
+void GetReciproceAction::actId(ptr<C>& value, const std::string& name,
+			       int size, int fkConstraints)
+{ 
+  actPtr(PtrRef<C>(value, name, size, fkConstraints));
+}
+
+template<typename V>
+void GetReciproceAction::act(const FieldRef<V>& field)
+{ }
+
+template<class C>
+void GetReciproceAction::actPtr(const PtrRef<C>& field)
+{ 
+  if (field.name() == joinName_)
+    value_ = field.value().obj();
+}
+
+template<class C>
+void GetReciproceAction::actWeakPtr(const WeakPtrRef<C>& field)
+{
+}
+
+template<class C>
+void GetReciproceAction::actCollection(const CollectionRef<C>& field)
+{
 }
 
     /*
@@ -861,6 +921,264 @@ template<class C>
 void FromAnyAction::actCollection(const CollectionRef<C>& field)
 { }
 
+    /*
+     * PrefetchAction
+     */
+
+template<class C>
+void PrefetchAction::visit(C& obj)
+{
+  visited_ = true;
+
+  persist<C>::apply(obj, *this);
+}
+
+template<typename V>
+void PrefetchAction::actId(V& value, const std::string& name, int size)
+{ }
+
+template<class C>
+void PrefetchAction::actId(ptr<C>& value, const std::string& name,
+			   int size, int fkConstraints)
+{ 
+  actPtr(PtrRef<C>(value, name, size, fkConstraints));
+}
+
+template<typename V>
+void PrefetchAction::act(const FieldRef<V>& field)
+{ }
+
+template<class C>
+void PrefetchAction::actPtr(const PtrRef<C>& field)
+{
+  if (field.name() != relation_)
+    return;
+
+  if (!batch_)
+    batch_ = new Impl::PrefetchBatch<C>();
+
+  Impl::PrefetchBatch<C> *batch
+    = dynamic_cast<Impl::PrefetchBatch<C> *>(batch_);
+
+  if (batch && field.value())
+    batch->objects.push_back(field.value());
+}
+
+template<class C>
+void PrefetchAction::actWeakPtr(const WeakPtrRef<C>& field)
+{ }
+
+template<class C>
+void PrefetchAction::actCollection(const CollectionRef<C>& field)
+{
+  if (field.type() != ManyToOne
+      || relation_ != session_.template tableName<C>())
+    return;
+
+  if (!batch_)
+    batch_ = new Impl::PrefetchCollectionBatch<C>();
+
+  Impl::PrefetchCollectionBatch<C> *batch
+    = dynamic_cast<Impl::PrefetchCollectionBatch<C> *>(batch_);
+
+  if (batch)
+    batch->collections.push_back(&field.value());
+}
+
+    /*
+     * PersistPlanAction
+     */
+
+    namespace Impl {
+
+template <typename V>
+void readPlanColumn(void *value, SqlStatement *statement, int column, int size)
+{
+  sql_value_traits<V>::read(*static_cast<V *>(value), statement, column, size);
+}
+
+template <typename V>
+void bindPlanColumn(const void *value, SqlStatement *statement, int column,
+		    int size)
+{
+  sql_value_traits<V>::bind(*static_cast<const V *>(value), statement, column,
+			    size);
+}
+
+template <class C, typename V>
+void setPlanId(MetaDbo<C>& dbo, const void *value)
+{
+  dbo.setId(*static_cast<const V *>(value));
+}
+
+    }
+
+template<class C>
+PersistPlanAction<C>::PersistPlanAction(Impl::PersistPlan<C>& plan, C& obj,
+					Session& session)
+  : plan_(plan),
+    obj_(reinterpret_cast<const char *>(&obj)),
+    session_(session),
+    compiled_(true)
+{ }
+
+template<class C>
+void PersistPlanAction<C>::visit(C& obj)
+{
+  plan_.columns.clear();
+  plan_.idOffset = -1;
+  plan_.setId = 0;
+
+  persist<C>::apply(obj, *this);
+
+  if (compiled_)
+    plan_.state = Impl::PersistPlan<C>::Compiled;
+  else {
+    plan_.state = Impl::PersistPlan<C>::Generic;
+    plan_.columns.clear();
+  }
+}
+
+template<class C>
+template<typename V>
+bool PersistPlanAction<C>::isMember(const V& value, std::ptrdiff_t& offset)
+{
+  /*
+   * Only members of the object itself can be compiled: persist() may
+   * also map a local variable, which is then converted.
+   */
+  const char *v = reinterpret_cast<const char *>(&value);
+  std::less<const char *> before;
+  if (before(v, obj_) || before(obj_ + sizeof(C), v + sizeof(V))) {
+    compiled_ = false;
+    return false;
+  }
+
+  offset = v - obj_;
+  return true;
+}
+
+template<class C>
+template<typename V>
+void PersistPlanAction<C>::actId(V& value, const std::string& name, int size)
+{
+  field(*this, value, name, size);
+
+  if (isMember(value, plan_.idOffset))
+    plan_.setId = &Impl::setPlanId<C, V>;
+}
+
+template<class C>
+template<class D>
+void PersistPlanAction<C>::actId(ptr<D>& value, const std::string& name,
+				 int size, int fkConstraints)
+{
+  compiled_ = false;
+}
+
+template<class C>
+template<typename V>
+void PersistPlanAction<C>::act(const FieldRef<V>& field)
+{
+  typename Impl::PersistPlan<C>::Column c;
+
+  if (isMember(field.value(), c.offset)) {
+    c.size = field.size();
+    c.read = &Impl::readPlanColumn<V>;
+    c.bind = &Impl::bindPlanColumn<V>;
+    plan_.columns.push_back(c);
+  }
+}
+
+template<class C>
+template<class D>
+void PersistPlanAction<C>::actPtr(const PtrRef<D>& field)
+{
+  compiled_ = false;
+}
+
+template<class C>
+template<class D>
+void PersistPlanAction<C>::actWeakPtr(const WeakPtrRef<D>& field)
+{
+  compiled_ = false;
+}
+
+template<class C>
+template<class D>
+void PersistPlanAction<C>::actCollection(const CollectionRef<D>& field)
+{
+  compiled_ = false;
+}
+
+    namespace Impl {
+
+template <class C>
+void PrefetchBatch<C>::load(Session& session)
+{
+  session.loadBatch(objects);
+}
+
+template <class C>
+void PrefetchCollectionBatch<C>::load(Session& session)
+{
+  session.loadBatch(collections);
+}
+
+template <class C>
+PersistPlan<C>::PersistPlan()
+  : state(NotCompiled),
+    idOffset(-1),
+    setId(0)
+{ }
+
+template <class C>
+bool PersistPlan<C>::compile(C& obj, Session& session)
+{
+  if (state == NotCompiled) {
+    if (dbo_traits<C>::persistPlan()) {
+      PersistPlanAction<C> action(*this, obj, session);
+      action.visit(obj);
+    } else
+      state = Generic;
+  }
+
+  return state == Compiled;
+}
+
+template <class C>
+void PersistPlan<C>::load(C& obj, MetaDbo<C>& dbo, SqlStatement *statement,
+			  int& column) const
+{
+  char *base = reinterpret_cast<char *>(&obj);
+
+  for (unsigned i = 0; i < columns.size(); ++i) {
+    const Column& c = columns[i];
+    c.read(base + c.offset, statement, column++, c.size);
+  }
+
+  if (setId)
+    setId(dbo, base + idOffset);
+}
+
+template <class C>
+void PersistPlan<C>::bind(const C& obj, MetaDbo<C>& dbo, bool isInsert,
+			  SqlStatement *statement, int& column) const
+{
+  const char *base = reinterpret_cast<const char *>(&obj);
+
+  for (unsigned i = 0; i < columns.size(); ++i) {
+    const Column& c = columns[i];
+    c.bind(base + c.offset, statement, column++, c.size);
+  }
+
+  /* Later, we may also want to support id changes ? */
+  if (isInsert && setId)
+    setId(dbo, base + idOffset);
+}
+
+    }
+
   }
 }
 
@@ -8,9 +8,43 @@
 #define WT_DBO_QUERY_MODEL_IMPL_H_
 
 #include <Wt/Dbo/QueryColumn>
+#include <Wt/Dbo/WtSqlTraits>
 
 namespace Wt {
   namespace Dbo {
+    namespace Impl {
+
+template <class Result>
+void bindKeyset(Query<Result>& query, const boost::any& value)
+{
+  const std::type_info& t = value.type();
+
+  if (t == typeid(long long))
+    query.bind(boost::any_cast<long long>(value));
+  else if (t == typeid(int))
+    query.bind(boost::any_cast<int>(value));
+  else if (t == typeid(short))
+    query.bind(boost::any_cast<short>(value));
+  else if (t == typeid(double))
+    query.bind(boost::any_cast<double>(value));
+  else if (t == typeid(float))
+    query.bind(boost::any_cast<float>(value));
+  else if (t == typeid(std::string))
+    query.bind(boost::any_cast<std::string>(value));
+  else if (t == typeid(WString))
+    query.bind(boost::any_cast<WString>(value));
+  else if (t == typeid(WDate))
+    query.bind(boost::any_cast<WDate>(value));
+  else if (t == typeid(WDateTime))
+    query.bind(boost::any_cast<WDateTime>(value));
+  else if (t == typeid(boost::posix_time::ptime))
+    query.bind(boost::any_cast<boost::posix_time::ptime>(value));
+  else
+    throw Exception(std::string("QueryModel: unsupported keyset field type: ")
+		    + t.name());
+}
+
+    }
 
 template <class Result>
 QueryModel<Result>::QueryModel(WObject *parent)
@@ -18,7 +52,14 @@ QueryModel<Result>::QueryModel(WObject *parent)
     batchSize_(40),
     cachedRowCount_(-1),
     cacheStart_(-1),
-    currentRow_(-1)
+    currentRow_(-1),
+    keysetFieldIdx_(-1),
+    keysetOrder_(AscendingOrder),
+    keysetActive_(false),
+    cacheAtEnd_(false),
+    readAhead_(0),
+    rowCountCacheTime_(0),
+    rowCountTime_(0)
 { }
 
 template <class Result>
@@ -28,6 +69,14 @@ void QueryModel<Result>::setQuery(const Query<Result>& query,
   queryLimit_ = query.limit();
   queryOffset_ = query.offset();
 
+  /* A cached row count does not apply to another query */
+  cachedRowCount_ = -1;
+  rowCountTime_ = 0;
+
+  keysetField_.clear();
+  keysetFieldIdx_ = -1;
+  keysetActive_ = false;
+
   if (!keepColumns) {
     query_ = query;
     fields_ = query_.fields();
@@ -47,6 +96,43 @@ void QueryModel<Result>::setBatchSize(int count)
   batchSize_ = count;
 }
 
+template <class Result>
+void QueryModel<Result>::setKeysetPagination(const std::string& field,
+					     SortOrder order)
+{
+  if (Impl::hasWhereClause(query_.sql_))
+    throw Exception("QueryModel::setKeysetPagination(): the query SQL may "
+		    "not contain a 'where' clause, use Query::where() "
+		    "instead");
+
+  int rc = cachedRowCount_;
+
+  invalidateData();
+
+  keysetField_ = field;
+  keysetFieldIdx_ = getFieldIndex(field);
+  keysetOrder_ = order;
+  keysetActive_ = true;
+
+  query_.orderBy(fields_[keysetFieldIdx_].sql() + " "
+		 + (order == AscendingOrder ? "asc" : "desc"));
+
+  cachedRowCount_ = rc;
+  dataReloaded();
+}
+
+template <class Result>
+void QueryModel<Result>::setReadAhead(int rows)
+{
+  readAhead_ = rows;
+}
+
+template <class Result>
+void QueryModel<Result>::setRowCountCacheTime(int seconds)
+{
+  rowCountCacheTime_ = seconds;
+}
+
 template <class Result>
 int QueryModel<Result>::addColumn(const std::string& field,
 				  const WString& header,
@@ -108,6 +194,7 @@ int QueryModel<Result>::rowCount(const WModelIndex& parent) const
     query_.limit(queryLimit_);
     query_.offset(queryOffset_);
     cachedRowCount_ = static_cast<int>(query_.resultList().size());
+    rowCountTime_ = std::time(0);
 
     transaction.commit();
   }
@@ -179,10 +266,16 @@ void QueryModel<Result>::invalidateData()
 {
   layoutAboutToBeChanged().emit();
 
-  cachedRowCount_ = cacheStart_ = currentRow_ = -1;
+  if (rowCountCacheTime_ <= 0
+      || std::time(0) - rowCountTime_ >= rowCountCacheTime_)
+    cachedRowCount_ = -1;
+
+  cacheStart_ = currentRow_ = -1;
   cache_.clear();
+  cacheAtEnd_ = false;
   rowValues_.clear();
   stableIds_.clear();
+  keysets_.clear();
 }
 
 template <class Result>
@@ -201,9 +294,14 @@ void QueryModel<Result>::sort(int column, SortOrder order)
 
   invalidateData();
 
-  query_.orderBy(fields_[columns_[column].fieldIdx_].sql() + " "
+  int fieldIdx = columns_[column].fieldIdx_;
+
+  query_.orderBy(fields_[fieldIdx].sql() + " "
 		 + (order == AscendingOrder ? "asc" : "desc"));
 
+  keysetActive_ = !keysetField_.empty() && fieldIdx == keysetFieldIdx_;
+  keysetOrder_ = order;
+
   cachedRowCount_ = rc;
   dataReloaded();
 }
@@ -222,41 +320,107 @@ Result QueryModel<Result>::stableResultRow(int row) const
 template <class Result>
 Result& QueryModel<Result>::resultRow(int row)
 {
-  if (row < cacheStart_
-      || row >= cacheStart_ + static_cast<int>(cache_.size())) {
-    cacheStart_ = std::max(row - batchSize_ / 4, 0);
+  int cacheEnd = cacheStart_ + static_cast<int>(cache_.size());
 
-    int qOffset = cacheStart_;
-    if (queryOffset_ > 0)
-      qOffset += queryOffset_;
-    query_.offset(qOffset);
-
-    int qLimit = batchSize_;
-    if (queryLimit_ > 0)
-      qLimit = std::min(batchSize_, queryLimit_ - cacheStart_);
-    query_.limit(qLimit);
+  if (row < cacheStart_ || row >= cacheEnd) {
+    cacheStart_ = std::max(row - batchSize_ / 4, 0);
 
     Transaction transaction(query_.session());
 
-    collection<Result> results = query_.resultList();
     cache_.clear();
-    cache_.insert(cache_.end(), results.begin(), results.end());   
-
-    for (unsigned i = 0; i < cache_.size(); ++i) {
-      long long id = resultId(cache_[i]);
-      if (id != -1)
-	stableIds_[cacheStart_ + i] = id;
-    }
+    fetchBatch(cacheStart_, batchSize_, cache_);
 
     if (row >= cacheStart_ + static_cast<int>(cache_.size()))
       throw Exception("QueryModel: geometry inconsistent with database");
 
+    transaction.commit();
+  } else if (readAhead_ > 0 && row >= cacheEnd - readAhead_ && !cacheAtEnd_) {
+    /*
+     * Read ahead: append the next batch, keeping at most two batches.
+     */
+    Transaction transaction(query_.session());
+
+    fetchBatch(cacheEnd, batchSize_, cache_);
+
+    int excess = static_cast<int>(cache_.size()) - 2 * batchSize_;
+    excess = std::min(excess, row - cacheStart_);
+    if (excess > 0) {
+      cache_.erase(cache_.begin(), cache_.begin() + excess);
+      cacheStart_ += excess;
+    }
+
     transaction.commit();
   }
 
   return cache_[row - cacheStart_];
 }
 
+/*
+ * Fetches count results starting at row start, appending them to
+ * results.
+ */
+template <class Result>
+void QueryModel<Result>::fetchBatch(int start, int count,
+				    std::vector<Result>& results)
+{
+  int qLimit = count;
+  if (queryLimit_ > 0)
+    qLimit = std::min(count, queryLimit_ - start);
+
+  if (qLimit <= 0) {
+    cacheAtEnd_ = true;
+    return;
+  }
+
+  int qOffset = start;
+  if (queryOffset_ > 0)
+    qOffset += queryOffset_;
+
+  Query<Result> query = query_;
+
+  if (keysetActive_) {
+    /*
+     * Seek from the key of the nearest row before start that we know
+     */
+    KeysetMap::const_iterator k = keysets_.upper_bound(start - 1);
+
+    if (k != keysets_.begin()) {
+      --k;
+
+      query.where(fields_[keysetFieldIdx_].sql()
+		  + (keysetOrder_ == AscendingOrder ? " > ?" : " < ?"));
+      Impl::bindKeyset(query, k->second);
+
+      qOffset = start - 1 - k->first;
+    }
+  }
+
+  query.offset(qOffset);
+  query.limit(qLimit);
+
+  collection<Result> batch = query.resultList();
+
+  int first = static_cast<int>(results.size());
+  results.insert(results.end(), batch.begin(), batch.end());
+  int fetched = static_cast<int>(results.size()) - first;
+
+  int cacheStart = start - first;
+  for (int i = first; i < static_cast<int>(results.size()); ++i) {
+    long long id = resultId(results[i]);
+    if (id != -1)
+      stableIds_[cacheStart + i] = id;
+  }
+
+  cacheAtEnd_ = fetched < qLimit
+    || (queryLimit_ > 0 && start + fetched >= queryLimit_);
+
+  if (keysetActive_ && fetched > 0) {
+    AnyList values;
+    query_result_traits<Result>::getValues(results.back(), values);
+    keysets_[start + fetched - 1] = values[keysetFieldIdx_];
+  }
+}
+
 template <class Result>
 void QueryModel<Result>::invalidateRow(int row)
 {
@@ -386,6 +550,9 @@ bool QueryModel<Result>::removeRows(int row, int count,
 
   cachedRowCount_ -= count;
 
+  /* Rows shifted: the known keys no longer correspond */
+  keysets_.clear();
+
   endRemoveRows();
 
   return true;
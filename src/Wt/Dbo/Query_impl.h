@@ -7,11 +7,16 @@
 #ifndef WT_DBO_QUERY_IMPL_H_
 #define WT_DBO_QUERY_IMPL_H_
 
+#include <iostream>
+#include <boost/bind.hpp>
+#include <boost/static_assert.hpp>
 #include <boost/tuple/tuple.hpp>
 
 #include <Wt/Dbo/Exception>
 #include <Wt/Dbo/Field>
+#include <Wt/Dbo/QueryCache>
 #include <Wt/Dbo/SqlStatement>
+#include <Wt/Dbo/Transaction>
 #include <Wt/Dbo/DbAction>
 
 #include <Wt/Dbo/Field_impl.h>
@@ -62,6 +67,30 @@ extern void WTDBO_API
 parseSql(const std::string& sql, SelectFieldLists& fieldLists,
 	 bool& simpleSelectCount);
 
+/* Whether the sql has a 'where' clause, other than within a subquery */
+extern bool WTDBO_API hasWhereClause(const std::string& sql);
+
+/* Sets a flag for the lifetime of this object */
+class ScopedFlag
+{
+public:
+  ScopedFlag(bool& flag) : flag_(flag) { flag_ = true; }
+  ~ScopedFlag() { flag_ = false; }
+
+private:
+  bool& flag_;
+};
+
+template <class Result>
+struct IsPtrResult {
+  static const bool value = false;
+};
+
+template <class C>
+struct IsPtrResult< ptr<C> > {
+  static const bool value = true;
+};
+
 template <class Result>
 QueryBase<Result>::QueryBase()
   : session_(0)
@@ -332,19 +361,54 @@ namespace Impl {
   {
     return new Parameter<T>(v_);
   }
+
+  /*
+   * Completes Query::resultListAsync(): calls the handler, and then
+   * releases the transaction that was kept open for the query. This
+   * runs from an I/O thread, so nothing may propagate from here.
+   */
+  template <class Result>
+  void resultListDone(const boost::function<void (const collection<Result>&)>&
+		      handler, collection<Result> result,
+		      Transaction *transaction)
+  {
+    try {
+      try {
+	handler(result);
+      } catch (std::exception& e) {
+	std::cerr << "Dbo: resultListAsync(): handler threw: "
+		  << e.what() << std::endl;
+	transaction->rollback();
+      }
+
+      transaction->commit();
+    } catch (std::exception& e) {
+      std::cerr << "Dbo: resultListAsync(): transaction failed: "
+		<< e.what() << std::endl;
+    }
+
+    try {
+      delete transaction;
+    } catch (std::exception& e) {
+      std::cerr << "Dbo: resultListAsync(): rollback failed: "
+		<< e.what() << std::endl;
+    }
+  }
 }
 
 template <class Result>
 Query<Result, DynamicBinding>::Query()
   : limit_(-1),
-    offset_(-1)
+    offset_(-1),
+    cacheTime_(0)
 { }
 
 template <class Result>
 Query<Result, DynamicBinding>::Query(Session& session, const std::string& sql)
   : Impl::QueryBase<Result>(session, sql),
     limit_(-1),
-    offset_(-1)
+    offset_(-1),
+    cacheTime_(0)
 { }
 
 template <class Result>
@@ -353,7 +417,8 @@ Query<Result, DynamicBinding>::Query(Session& session,
 				     const std::string& where)
   : Impl::QueryBase<Result>(session, table, where),
     limit_(-1),
-    offset_(-1)
+    offset_(-1),
+    cacheTime_(0)
 { }
 
 template <class Result>
@@ -364,7 +429,9 @@ Query<Result, DynamicBinding>
     groupBy_(other.groupBy_),
     orderBy_(other.orderBy_),
     limit_(other.limit_),
-    offset_(other.offset_)
+    offset_(other.offset_),
+    prefetch_(other.prefetch_),
+    cacheTime_(other.cacheTime_)
 { 
   for (unsigned i = 0; i < other.parameters_.size(); ++i)
     parameters_.push_back(other.parameters_[i]->clone());
@@ -381,6 +448,8 @@ Query<Result, DynamicBinding>::operator=
   orderBy_ = other.orderBy_;
   limit_ = other.limit_;
   offset_ = other.offset_;
+  prefetch_ = other.prefetch_;
+  cacheTime_ = other.cacheTime_;
 
   reset();
 
@@ -468,6 +537,33 @@ int Query<Result, DynamicBinding>::limit() const
   return limit_;
 }
 
+template <class Result>
+Query<Result, DynamicBinding>&
+Query<Result, DynamicBinding>::prefetch(const std::string& relation)
+{
+  /* Only ptr<C> results have relations that can be prefetched */
+  BOOST_STATIC_ASSERT(Impl::IsPtrResult<Result>::value);
+
+  prefetch_.push_back(relation);
+
+  return *this;
+}
+
+template <class Result>
+Query<Result, DynamicBinding>&
+Query<Result, DynamicBinding>::cache(int seconds)
+{
+  cacheTime_ = seconds;
+
+  return *this;
+}
+
+template <class Result>
+int Query<Result, DynamicBinding>::cache() const
+{
+  return cacheTime_;
+}
+
 template <class Result>
 Result Query<Result, DynamicBinding>::resultValue() const
 {
@@ -490,7 +586,102 @@ collection<Result> Query<Result, DynamicBinding>::resultList() const
   bindParameters(statement);
   bindParameters(countStatement);
 
-  return collection<Result>(this->session_, statement, countStatement);
+  if (cacheTime_ > 0 && this->session_->queryCache())
+    return cachedResultList(statement, countStatement);
+
+  collection<Result> result(this->session_, statement, countStatement);
+  result.data_.query->prefetch = prefetch_;
+
+  return result;
+}
+
+template <class Result>
+collection<Result> Query<Result, DynamicBinding>
+::cachedResultList(SqlStatement *statement, SqlStatement *countStatement)
+  const
+{
+  std::string sql = statement->sql();
+  std::set<std::string> tables = this->session_->referencedTables(sql);
+
+  /*
+   * A transaction that changed a table sees uncommitted data, which
+   * may neither be served from nor stored in the cache.
+   */
+  if (this->session_->changedInTransaction(tables)) {
+    collection<Result> result(this->session_, statement, countStatement);
+    result.data_.query->prefetch = prefetch_;
+
+    return result;
+  }
+
+  ScopedStatementUse use(statement), countUse(countStatement);
+
+  QueryCache *cache = this->session_->queryCache();
+
+  Impl::QueryCacheKey key(typeid(Result), sql);
+  bindParameters(&key);
+
+  boost::shared_ptr<const Impl::CachedResult> rows = cache->find(key.key());
+
+  if (!rows) {
+    std::vector<long long> versions = cache->versions(tables);
+    Impl::RecordingStatement recorder(statement);
+
+    /*
+     * Objects that this session already loaded must still be read
+     * completely: the recording is replayed in other sessions.
+     */
+    Impl::ScopedFlag readLoaded(this->session_->readLoadedObjects_);
+
+    recorder.execute();
+    while (recorder.nextRow()) {
+      int column = 0;
+      query_result_traits<Result>::load(*this->session_, recorder, column);
+    }
+
+    rows = recorder.result();
+    cache->store(key.key(), rows, tables, versions, cacheTime_);
+  }
+
+  Impl::ReplayStatement *replay = new Impl::ReplayStatement(sql, rows);
+  replay->use();
+
+  collection<Result> result(this->session_, replay, 0);
+  result.data_.query->ownedStatement = replay;
+  result.data_.query->size = rows->rows.size();
+  result.data_.query->prefetch = prefetch_;
+
+  return result;
+}
+
+template <class Result>
+void Query<Result, DynamicBinding>
+::resultListAsync(const ResultHandler& handler) const
+{
+  collection<Result> result = resultList();
+
+  if (!this->session_) {
+    handler(result);
+    return;
+  }
+
+  /*
+   * Joins the current transaction, so that it is not committed before
+   * the handler has been called.
+   */
+  Transaction *transaction = new Transaction(*this->session_);
+
+  result.data_.query->executed = true;
+
+  try {
+    result.data_.query->statement->executeAsync
+      (boost::bind(&Impl::resultListDone<Result>, handler, result,
+		   transaction));
+  } catch (...) {
+    result.data_.query->executed = false;
+    delete transaction;
+    throw;
+  }
 }
 
 template <class Result>
@@ -7,6 +7,7 @@
 #ifndef WT_DBO_SESSION_IMPL_H_
 #define WT_DBO_SESSION_IMPL_H_
 
+#include <algorithm>
 #include <iostream>
 
 #include <Wt/Dbo/SqlConnection>
@@ -105,6 +106,152 @@ ptr<C> Session::load(SqlStatement *statement, int& column)
     ::load(this, statement, column);
 }
 
+template <class C>
+void Session::loadBatch(const std::vector< ptr<C> >& objects)
+{
+  /*
+   * Number of ids bound to a single "in (...)" condition. Smaller
+   * batches are padded to a power of two, so that only a handful of
+   * distinct statements gets prepared.
+   */
+  const unsigned MaxBatchSize = 256;
+
+  Mapping<C> *mapping = getMapping<C>();
+
+  std::vector<MetaDbo<C> *> toLoad;
+  std::set<MetaDbo<C> *> seen;
+
+  for (unsigned i = 0; i < objects.size(); ++i) {
+    MetaDbo<C> *dbo = objects[i].obj();
+
+    if (dbo && dbo->session() == this && dbo->isPersisted()
+	&& !dbo->isLoaded() && !dbo->isDeleted()
+	&& seen.insert(dbo).second)
+      toLoad.push_back(dbo);
+  }
+
+  if (!mapping->surrogateIdFieldName) {
+    /* Natural ids may span multiple fields: load these one by one */
+    for (unsigned i = 0; i < toLoad.size(); ++i)
+      toLoad[i]->obj();
+
+    return;
+  }
+
+  std::string idField = std::string("\"") + mapping->surrogateIdFieldName
+    + "\"";
+
+  for (unsigned first = 0; first < toLoad.size(); first += MaxBatchSize) {
+    unsigned count = std::min(MaxBatchSize,
+			      (unsigned)toLoad.size() - first);
+
+    unsigned padded = 1;
+    while (padded < count)
+      padded *= 2;
+
+    std::string condition = idField + " in (";
+    for (unsigned i = 0; i < padded; ++i) {
+      if (i != 0)
+	condition += ", ";
+      condition += "?";
+    }
+    condition += ")";
+
+    Query< ptr<C> > query = find<C>().where(condition);
+
+    for (unsigned i = 0; i < padded; ++i)
+      query.bind(toLoad[first + std::min(i, count - 1)]->id());
+
+    /* Loading the results populates the objects in the registry */
+    collection< ptr<C> > results = query.resultList();
+    for (typename collection< ptr<C> >::const_iterator i = results.begin();
+	 i != results.end(); ++i)
+      ;
+  }
+}
+
+template <class C>
+void Session::loadBatch(const std::vector< collection< ptr<C> > *>& collections)
+{
+  /* See loadBatch(const std::vector< ptr<C> >&) */
+  const unsigned MaxBatchSize = 256;
+
+  typedef collection< ptr<C> > Collection;
+
+  /*
+   * Group the collections by relation, since their owners may have
+   * more than one hasMany() relation with C.
+   */
+  typedef std::map<const std::string *, std::vector<Collection *> > Relations;
+  Relations relations;
+  std::set<Collection *> seen;
+
+  for (unsigned i = 0; i < collections.size(); ++i) {
+    Collection *c = collections[i];
+
+    if (c->type_ == Collection::RelationCollection && c->data_.relation.sql
+	&& c->data_.relation.setInfo->type == ManyToOne
+	&& c->data_.relation.dbo->isPersisted()
+	&& !c->prefetched() && seen.insert(c).second)
+      relations[c->data_.relation.sql].push_back(c);
+  }
+
+  for (typename Relations::const_iterator r = relations.begin();
+       r != relations.end(); ++r) {
+    const std::vector<Collection *>& owners = r->second;
+
+    /* The collection is selected with: where "joinName_id" = ? */
+    const std::string& sql = *r->first;
+    std::size_t w = Impl::ifind(sql, " where ");
+    std::string foreignKey = sql.substr(w + 7, sql.length() - w - 11);
+
+    /* A foreign key that spans multiple fields: iterate one by one */
+    if (Impl::ifind(foreignKey, " and ") != std::string::npos)
+      continue;
+
+    const std::string& joinName = owners[0]->data_.relation.setInfo->joinName;
+
+    std::map<MetaDboBase *, std::vector< ptr<C> > > children;
+
+    for (unsigned first = 0; first < owners.size(); first += MaxBatchSize) {
+      unsigned count = std::min(MaxBatchSize,
+				(unsigned)owners.size() - first);
+
+      unsigned padded = 1;
+      while (padded < count)
+	padded *= 2;
+
+      std::string condition = foreignKey + " in (";
+      for (unsigned i = 0; i < padded; ++i) {
+	if (i != 0)
+	  condition += ", ";
+	condition += "?";
+      }
+      condition += ")";
+
+      Query< ptr<C> > query = find<C>().where(condition);
+
+      for (unsigned i = 0; i < padded; ++i)
+	owners[first + std::min(i, count - 1)]->data_.relation.dbo
+	  ->bindId(query.parameters_);
+
+      collection< ptr<C> > results = query.resultList();
+      for (typename collection< ptr<C> >::const_iterator i = results.begin();
+	   i != results.end(); ++i) {
+	ptr<C> child = *i;
+
+	GetReciproceAction action(this, joinName);
+	action.visit(const_cast<C&>(*child));
+
+	children[action.value()].push_back(child);
+      }
+    }
+
+    for (unsigned i = 0; i < owners.size(); ++i)
+      owners[i]->setPrefetched(children[owners[i]->data_.relation.dbo]);
+  }
+}
+
 template <class C>
 ptr<C> Session::loadWithNaturalId(SqlStatement *statement, int& column)
 {
@@ -173,7 +320,17 @@ ptr<C> Session::loadWithLongLongId(SqlStatement *statement, int& column)
     } else {
       if (!i->second->isLoaded())
 	implLoad<C>(*i->second, statement, column);
-      else
+      else if (readLoadedObjects_) {
+	/*
+	 * The query cache records the columns that are read: read them
+	 * into a copy that is discarded, for replaying in other sessions.
+	 */
+	MetaDbo<C> *copy
+	  = new MetaDbo<C>(id, -1, MetaDboBase::Persisted, *this, 0);
+	implLoad<C>(*copy, statement, column);
+	copy->setSession(0);
+	delete copy;
+      } else
 	column += (int)mapping->fields.size() + 1; // + version
 
       return ptr<C>(i->second);
@@ -277,6 +434,7 @@ void Session::implSave(MetaDbo<C>& dbo)
     transaction_->objects_.push_back(new ptr<C>(&dbo));
 
   Session::Mapping<C> *mapping = getMapping<C>();
+  tablesChanged(mapping);
 
   SaveDbAction<C> action(dbo, *mapping);
   action.visit(*dbo.obj());
@@ -294,6 +452,8 @@ void Session::implDelete(MetaDbo<C>& dbo)
   if (!dbo.savedInTransaction())
     transaction_->objects_.push_back(new ptr<C>(&dbo));
 
+  tablesChanged(getMapping<C>());
+
   bool versioned = getMapping<C>()->versionFieldName && dbo.obj() != 0;
   SqlStatement *statement
     = getStatement<C>(versioned ? SqlDeleteVersioned : SqlDelete);
@@ -35,6 +35,30 @@ namespace Wt {
 	    it.fetchNextRow();
 	}
       };
+
+      template <class C>
+      struct Prefetcher {
+	/* Query::prefetch() does not compile for other results */
+	static void prefetch(Session& session, std::vector<C>& results,
+			     const std::string& relation)
+	{ }
+      };
+
+      template <class T>
+      struct Prefetcher< ptr<T> >
+      {
+	static void prefetch(Session& session, std::vector< ptr<T> >& results,
+			     const std::string& relation)
+	{
+	  PrefetchAction action(session, relation);
+
+	  for (unsigned i = 0; i < results.size(); ++i)
+	    if (results[i])
+	      action.visit(const_cast<T&>(*results[i]));
+
+	  action.load();
+	}
+      };
     }
 
 template <class C>
@@ -144,8 +168,15 @@ shared_impl::shared_impl(const collection<C>& collection,
     useCount_(0),
     queryEnded_(false),
     posPastQuery_(0),
-    ended_(false)
+    ended_(false),
+    prefetchedPos_(0)
 {
+  if (statement_ && collection_.type_ == QueryCollection
+      && !collection_.data_.query->prefetch.empty())
+    prefetchRows();
+  else if (!statement_ && collection_.prefetched())
+    prefetched_ = *collection_.prefetched();
+
   fetchNextRow();
 }
 
@@ -158,6 +189,30 @@ collection<C>::iterator::shared_impl::~shared_impl()
   }
 }
 
+template <class C>
+void collection<C>::iterator::shared_impl::prefetchRows()
+{
+  /*
+   * Read all results up front, so that the related objects can be
+   * loaded in batch rather than one by one when they are dereferenced.
+   */
+  while (statement_->nextRow()) {
+    int column = 0;
+    prefetched_.push_back
+      (query_result_traits<C>::load(*collection_.session(), *statement_,
+				    column));
+  }
+
+  statement_->done();
+  collection_.iterateDone();
+  statement_ = 0;
+
+  const std::vector<std::string>& prefetch = collection_.data_.query->prefetch;
+  for (unsigned i = 0; i < prefetch.size(); ++i)
+    Impl::Prefetcher<C>::prefetch(*collection_.session(), prefetched_,
+				  prefetch[i]);
+}
+
 template <class C>
 void collection<C>::iterator::shared_impl::fetchNextRow()
 {
@@ -172,6 +227,13 @@ void collection<C>::iterator::shared_impl::fetchNextRow()
     return;
   }
 
+  if (prefetchedPos_ < prefetched_.size()) {
+    current_ = prefetched_[prefetchedPos_++];
+
+    Impl::Helper<C>::skipIfRemoved(*this);
+    return;
+  }
+
   if (!statement_ || !statement_->nextRow()) {
     queryEnded_ = true;
     if (collection_.manualModeInsertions().size() == 0)
@@ -293,6 +355,8 @@ collection<C>::collection()
   data_.relation.dbo = 0;
   data_.relation.setInfo = 0;
   data_.relation.activity = 0;
+  data_.relation.prefetched = 0;
+  data_.relation.prefetchVersion = 0;
 }
 
 template <class C>
@@ -306,6 +370,8 @@ collection<C>::collection(Session *session, SqlStatement *statement,
   data_.query->statement = statement;
   data_.query->countStatement = countStatement;
   data_.query->size = -1;
+  data_.query->executed = false;
+  data_.query->ownedStatement = 0;
 }
 
 template <class C>
@@ -314,9 +380,12 @@ collection<C>::collection(const collection<C>& other)
     type_(other.type_),
     data_(other.data_)
 {
-  if (type_ == RelationCollection)
+  if (type_ == RelationCollection) {
     data_.relation.activity = 0;
-  else
+    if (data_.relation.prefetched)
+      data_.relation.prefetched
+	= new std::vector<C>(*data_.relation.prefetched);
+  } else
     ++data_.query->useCount;
 }
 
@@ -329,6 +398,7 @@ void collection<C>::releaseQuery()
 	data_.query->statement->done();      
       if (data_.query->countStatement)
 	data_.query->countStatement->done();
+      delete data_.query->ownedStatement;
       delete data_.query;
     }
   }
@@ -337,18 +407,25 @@ void collection<C>::releaseQuery()
 template <class C>
 collection<C>& collection<C>::operator=(const collection<C>& other)
 {
-  if (type_ == RelationCollection)
+  if (this == &other)
+    return *this;
+
+  if (type_ == RelationCollection) {
     delete data_.relation.activity;
-  else
+    delete data_.relation.prefetched;
+  } else
     releaseQuery();
 
   session_ = other.session_;
   type_ = other.type_;
   data_ = other.data_;
   
-  if (type_ == RelationCollection)
+  if (type_ == RelationCollection) {
     data_.relation.activity = 0;
-  else
+    if (data_.relation.prefetched)
+      data_.relation.prefetched
+	= new std::vector<C>(*data_.relation.prefetched);
+  } else
     ++data_.query->useCount;
 
   return *this;
@@ -357,9 +434,10 @@ collection<C>& collection<C>::operator=(const collection<C>& other)
 template <class C>
 collection<C>::~collection()
 {
-  if (type_ == RelationCollection)
+  if (type_ == RelationCollection) {
     delete data_.relation.activity;
-  else
+    delete data_.relation.prefetched;
+  } else
     releaseQuery();
 }
 
@@ -378,10 +456,16 @@ SqlStatement *collection<C>::executeStatement() const
   if (session_ && session_->flushMode() == Auto)
     session_->flush();
 
-  if (type_ == QueryCollection)
+  if (type_ == QueryCollection) {
     statement = data_.query->statement;
-  else {
-    if (data_.relation.sql) {
+
+    /* Already executed asynchronously: use the result as is, once */
+    if (data_.query->executed) {
+      data_.query->executed = false;
+      return statement;
+    }
+  } else {
+    if (data_.relation.sql && !prefetched()) {
       statement = session_->getOrPrepareStatement(*data_.relation.sql);
       int column = 0;
       data_.relation.dbo->bindId(statement, column);
@@ -437,6 +521,9 @@ typename collection<C>::size_type collection<C>::size() const
 
   if (type_ == QueryCollection)
     countStatement = data_.query->countStatement;
+  else if (prefetched())
+    return prefetched()->size() + manualModeInsertions_.size()
+      - manualModeRemovals_.size();
   else {
     if (data_.relation.sql) {
       const std::string *sql = data_.relation.sql;
@@ -653,6 +740,28 @@ void collection<C>::setRelationData(MetaDboBase *dbo,
   data_.relation.sql = sql;
   data_.relation.dbo = dbo;
   data_.relation.setInfo = setInfo;
+
+  delete data_.relation.prefetched;
+  data_.relation.prefetched = 0;
+}
+
+template <class C>
+const std::vector<C> *collection<C>::prefetched() const
+{
+  /* Only valid until the session flushes changes or the transaction ends */
+  if (type_ == RelationCollection && data_.relation.prefetched
+      && data_.relation.prefetchVersion == session_->prefetchVersion_)
+    return data_.relation.prefetched;
+  else
+    return 0;
+}
+
+template <class C>
+void collection<C>::setPrefetched(const std::vector<C>& results)
+{
+  delete data_.relation.prefetched;
+  data_.relation.prefetched = new std::vector<C>(results);
+  data_.relation.prefetchVersion = session_->prefetchVersion_;
 }
 
   }
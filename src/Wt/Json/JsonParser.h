@@ -0,0 +1,423 @@
+// This may look like C code, but it's really -*- C++ -*-
+/*
+ * Copyright (C) 2014 Emweb bvba, Kessel-Lo, Belgium.
+ *
+ * See the LICENSE file for terms of use.
+ */
+#ifndef WT_JSON_JSON_PARSER_H_
+#define WT_JSON_JSON_PARSER_H_
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <boost/lexical_cast.hpp>
+
+#include "Wt/Json/Array"
+#include "Wt/Json/Object"
+#include "Wt/Json/Parser"
+#include "Wt/Json/Value"
+
+namespace Wt {
+  namespace Json {
+    namespace Impl {
+
+const int MAX_DEPTH = 1000;
+
+extern void appendUTF8(std::string& s, unsigned long code);
+
+/*
+ * Parses a number, advancing pos. Returns an error message (and sets
+ * pos to the error position) when this is not a valid number.
+ */
+extern const char *parseNumber(const char *& pos, const char *end,
+			       double& result);
+
+/*
+ * A single pass, recursive descent parser, which reports what it
+ * parses to a Handler:
+ *
+ * - startObject(), key(name), endObject()
+ * - startArray(), endArray()
+ * - string(s), number(d), boolean(b), null()
+ *
+ * Strings are scanned for runs of plain characters which are appended
+ * at once.
+ */
+template <class Handler>
+class JsonParser
+{
+public:
+  JsonParser(const std::string& input, Handler& handler)
+    : begin_(input.data()),
+      pos_(begin_),
+      end_(begin_ + input.length()),
+      depth_(0),
+      handler_(handler)
+  { }
+
+  void parse()
+  {
+    skipWhitespace();
+
+    if (pos_ != end_ && *pos_ == '{')
+      parseObject();
+    else if (pos_ != end_ && *pos_ == '[')
+      parseArray();
+    else
+      error("expected '{' or '['");
+
+    skipWhitespace();
+
+    if (pos_ != end_)
+      error("expected end");
+  }
+
+private:
+  const char *begin_, *pos_, *end_;
+  int depth_;
+  Handler& handler_;
+  std::string s_;
+
+  void error(const std::string& message)
+  {
+    std::size_t offset = pos_ - begin_;
+    std::string context(pos_, std::min(pos_ + 40, end_));
+
+    throw ParseError("Error parsing json: " + message + " at offset "
+		     + boost::lexical_cast<std::string>(offset)
+		     + ": \"" + context + "\"");
+  }
+
+  void skipWhitespace()
+  {
+    while (pos_ != end_) {
+      switch (*pos_) {
+      case ' ': case '\t': case '\n': case '\r':
+	++pos_;
+	break;
+      default:
+	return;
+      }
+    }
+  }
+
+  void expect(char c)
+  {
+    skipWhitespace();
+
+    if (pos_ == end_ || *pos_ != c)
+      error(std::string("expected '") + c + "'");
+
+    ++pos_;
+  }
+
+  void enter()
+  {
+    if (++depth_ > MAX_DEPTH)
+      error("nesting too deep");
+  }
+
+  void parseValue()
+  {
+    skipWhitespace();
+
+    if (pos_ == end_)
+      error("expected value");
+
+    switch (*pos_) {
+    case '{':
+      parseObject();
+      break;
+    case '[':
+      parseArray();
+      break;
+    case '"':
+      parseString();
+      handler_.string(s_);
+      break;
+    case 't':
+      parseLiteral("true");
+      handler_.boolean(true);
+      break;
+    case 'f':
+      parseLiteral("false");
+      handler_.boolean(false);
+      break;
+    case 'n':
+      parseLiteral("null");
+      handler_.null();
+      break;
+    default:
+      handler_.number(parseNumber());
+    }
+  }
+
+  void parseObject()
+  {
+    enter();
+    ++pos_; // '{'
+
+    handler_.startObject();
+
+    skipWhitespace();
+    if (pos_ != end_ && *pos_ == '}')
+      ++pos_;
+    else {
+      for (;;) {
+	skipWhitespace();
+	if (pos_ == end_ || *pos_ != '"')
+	  error("expected member name");
+
+	parseString();
+	handler_.key(s_);
+
+	expect(':');
+	parseValue();
+
+	skipWhitespace();
+	if (pos_ != end_ && *pos_ == ',')
+	  ++pos_;
+	else {
+	  expect('}');
+	  break;
+	}
+      }
+    }
+
+    handler_.endObject();
+
+    --depth_;
+  }
+
+  void parseArray()
+  {
+    enter();
+    ++pos_; // '['
+
+    handler_.startArray();
+
+    skipWhitespace();
+    if (pos_ != end_ && *pos_ == ']')
+      ++pos_;
+    else {
+      for (;;) {
+	parseValue();
+
+	skipWhitespace();
+	if (pos_ != end_ && *pos_ == ',')
+	  ++pos_;
+	else {
+	  expect(']');
+	  break;
+	}
+      }
+    }
+
+    handler_.endArray();
+
+    --depth_;
+  }
+
+  void parseLiteral(const char *literal)
+  {
+    const char *p = pos_;
+    for (const char *l = literal; *l; ++l, ++p)
+      if (p == end_ || *p != *l)
+	error(std::string("expected '") + literal + "'");
+
+    pos_ = p;
+  }
+
+  /*
+   * Parses a string into s_.
+   */
+  void parseString()
+  {
+    ++pos_; // '"'
+    s_.clear();
+
+    for (;;) {
+      const char *run = pos_;
+      while (pos_ != end_ && *pos_ != '"' && *pos_ != '\\')
+	++pos_;
+
+      s_.append(run, pos_);
+
+      if (pos_ == end_)
+	error("unterminated string");
+
+      if (*pos_ == '"') {
+	++pos_;
+	return;
+      }
+
+      ++pos_; // '\\'
+      if (pos_ == end_)
+	error("unterminated string");
+
+      switch (*pos_++) {
+      case '"': s_ += '"'; break;
+      case '\\': s_ += '\\'; break;
+      case '/': s_ += '/'; break;
+      case 'b': s_ += '\b'; break;
+      case 'f': s_ += '\f'; break;
+      case 'n': s_ += '\n'; break;
+      case 'r': s_ += '\r'; break;
+      case 't': s_ += '\t'; break;
+      case 'u': parseUnicodeEscape(); break;
+      default:
+	--pos_;
+	error("invalid escape");
+      }
+    }
+  }
+
+  unsigned long parseHex4()
+  {
+    if (end_ - pos_ < 4)
+      error("expected 4 hex digits");
+
+    unsigned long result = 0;
+    for (int i = 0; i < 4; ++i) {
+      char c = *pos_;
+      result <<= 4;
+      if (c >= '0' && c <= '9')
+	result |= c - '0';
+      else if (c >= 'a' && c <= 'f')
+	result |= c - 'a' + 10;
+      else if (c >= 'A' && c <= 'F')
+	result |= c - 'A' + 10;
+      else
+	error("expected 4 hex digits");
+      ++pos_;
+    }
+
+    return result;
+  }
+
+  void parseUnicodeEscape()
+  {
+    unsigned long code = parseHex4();
+
+    if (code >= 0xD800 && code <= 0xDBFF) {
+      /* A high surrogate, which should be followed by a low surrogate */
+      if (end_ - pos_ >= 6 && pos_[0] == '\\' && pos_[1] == 'u') {
+	const char *p = pos_;
+	pos_ += 2;
+	unsigned long low = parseHex4();
+	if (low >= 0xDC00 && low <= 0xDFFF)
+	  code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+	else {
+	  pos_ = p;
+	  code = 0xFFFD;
+	}
+      } else
+	code = 0xFFFD;
+    } else if (code >= 0xDC00 && code <= 0xDFFF)
+      code = 0xFFFD;
+
+    appendUTF8(s_, code);
+  }
+
+  double parseNumber()
+  {
+    double result;
+    const char *message = Impl::parseNumber(pos_, end_, result);
+
+    if (message)
+      error(message);
+
+    return result;
+  }
+};
+
+/*
+ * Builds a Value while parsing. Values are parsed in place into their
+ * parent object or array.
+ */
+class ValueBuilder
+{
+public:
+  ValueBuilder(Value& result)
+    : result_(result)
+  { }
+
+  void startObject()
+  {
+    Value& v = next();
+    v = Value(ObjectType);
+    stack_.push_back(Frame(&v, false));
+  }
+
+  void key(const std::string& name)
+  {
+    Object& object = *stack_.back().value;
+    stack_.back().member = &object[name];
+  }
+
+  void endObject()
+  {
+    stack_.pop_back();
+  }
+
+  void startArray()
+  {
+    Value& v = next();
+    stack_.push_back(Frame(&v, true));
+  }
+
+  void endArray()
+  {
+    Frame& f = stack_.back();
+
+    *f.value = Value(ArrayType);
+    Array& array = *f.value;
+    array.resize(f.items.size());
+    for (unsigned i = 0; i < f.items.size(); ++i)
+      array[i].swap(f.items[i]);
+
+    stack_.pop_back();
+  }
+
+  void string(const std::string& s) { next() = Value(WString::fromUTF8(s)); }
+  void number(double d) { next() = Value(d); }
+  void boolean(bool b) { next() = b ? Value::True : Value::False; }
+  void null() { next() = Value::Null; }
+
+private:
+  /*
+   * Array values are parsed into a deque, which does not copy them
+   * when it grows, and then swapped into the array.
+   */
+  struct Frame {
+    Frame(Value *v, bool isArray)
+      : value(v), member(0), isArray(isArray)
+    { }
+
+    Value *value, *member;
+    bool isArray;
+    std::deque<Value> items;
+  };
+
+  Value& result_;
+  std::deque<Frame> stack_;
+
+  Value& next()
+  {
+    if (stack_.empty())
+      return result_;
+
+    Frame& f = stack_.back();
+    if (f.isArray) {
+      f.items.push_back(Value());
+      return f.items.back();
+    } else
+      return *f.member;
+  }
+};
+
+    }
+  }
+}
+
+#endif // WT_JSON_JSON_PARSER_H_
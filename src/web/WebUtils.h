@@ -214,6 +214,18 @@ extern char *round_css_str(double d, int digits, char *buf);
 // Fast round and format to string routine, JS compliant
 extern char *round_js_str(double d, int digits, char *buf);
 
+// Fast round and format to string routine with a fixed number of
+// decimals, JS and CSS compliant: trailing zeros are omitted and values
+// that do not fit in fixed point are formatted using round_js_str()
+extern char *round_fixed_str(double d, int digits, char *buf);
+
+// Formats a fixed point value: value / 10^digits, trailing zeros omitted
+extern char *fixed_lltoa(long long value, int digits, char *result);
+
+// Rounds to a fixed point value (value * 10^digits), returns false if
+// the result does not fit
+extern bool round_fixed(double d, int digits, long long& result);
+
 // Only for Java target
 extern std::string toHexString(int i);
 